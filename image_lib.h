@@ -0,0 +1,105 @@
+/*
+image_lib.h
+C interface to the image processing functions in Tynan_main.cpp
+
+Build it as a shared library with:
+
+    g++ -std=c++11 -O2 -pthread -fPIC -shared -fvisibility=hidden -ffunction-sections -Wl,--gc-sections -DIMAGE_LIB -o libimage.so Tynan_main.cpp
+
+The functions work on pixel buffers owned by the caller. Nothing is kept
+between calls, and the functions may be called from several threads at once.
+*/
+
+#ifndef IMAGE_LIB_H
+#define IMAGE_LIB_H
+
+#if defined(__GNUC__)
+#define IMAGE_API __attribute__((visibility("default")))
+#else
+#define IMAGE_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Order of the bytes of one pixel */
+enum image_channel_order
+{
+    IMAGE_BGR = 0,   /* 3 bytes, as in a BMP file */
+    IMAGE_RGB = 1,   /* 3 bytes */
+    IMAGE_BGRA = 2,  /* 4 bytes */
+    IMAGE_RGBA = 3   /* 4 bytes */
+};
+
+/* Results */
+#define IMAGE_OK 0
+#define IMAGE_ERROR_ARGUMENT -1  /* Bad pointer, size, stride, channel order or process number */
+#define IMAGE_ERROR_SIZE -2      /* Output buffer is not the size the process makes */
+#define IMAGE_ERROR_FILE -3      /* File could not be read or written, or is not a 24 or 32-bit BMP */
+
+/*
+Pixels owned by the caller. Row r (0 is the top row) starts at
+data + r * stride, and stride may be larger than width times the pixel size.
+A negative stride means the rows are stored bottom to top, as in a BMP file,
+with data pointing at the top row. The filters work on color only: alpha
+bytes of an output are set to 255.
+*/
+typedef struct image_buffer
+{
+    unsigned char* data;
+    int width;
+    int height;
+    int stride;  /* Bytes from the start of one row to the start of the next, negative if bottom to top */
+    int order;   /* An image_channel_order */
+} image_buffer;
+
+/*
+Gets the size of the image process_1 to process_16 make from an image of the
+given size. The parameters are the same as for image_process().
+*/
+IMAGE_API int image_output_size(int process, int width, int height, double param1, double param2,
+                                int* output_width, int* output_height);
+
+/*
+Applies process_1 to process_16 to a buffer. param1 and param2 are the
+menu's parameters: scaling factor, number of rotations, x scale, radius,
+sigma, amount, angle or shrink factor for param1, and y scale (process 6) or
+quality (process 15) for param2. The output must already be the size
+image_output_size() gives.
+
+Processes 1-10 read the input and write the output directly. For the
+filters that treat each pixel on its own (1-3 and 7-10) the output may be
+the input buffer. Processes 11-16 look at neighborhoods and go through an
+internal copy. Other than that the buffers must not overlap.
+*/
+IMAGE_API int image_process(int process, double param1, double param2,
+                            const image_buffer* input, image_buffer* output);
+
+/*
+Applies the same process to count buffers, spread over threads threads
+(0 uses every core). Each buffer is done on one thread, so no more than
+threads threads run at once. Returns IMAGE_OK, or the first error met; every
+pair is still attempted.
+*/
+IMAGE_API int image_process_batch(int process, double param1, double param2,
+                                  const image_buffer* inputs, image_buffer* outputs, int count, int threads);
+
+/* Gets the size of the image in a BMP file */
+IMAGE_API int image_bmp_size(const char* filename, int* width, int* height);
+
+/* Reads a BMP file into a buffer that is already the image's size */
+IMAGE_API int image_read_bmp(const char* filename, image_buffer* output);
+
+/* Writes a buffer to a 24-bit BMP file */
+IMAGE_API int image_write_bmp(const char* filename, const image_buffer* input);
+
+/* Reads or writes count BMP files, spread over threads threads (0 uses every core) */
+IMAGE_API int image_read_bmp_batch(const char* const* filenames, image_buffer* outputs, int count, int threads);
+IMAGE_API int image_write_bmp_batch(const char* const* filenames, const image_buffer* inputs, int count, int threads);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif